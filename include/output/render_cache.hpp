@@ -0,0 +1,83 @@
+#ifndef OUTPUT_RENDER_CACHE
+#define OUTPUT_RENDER_CACHE
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "sink.hpp"
+
+namespace vo {
+  /*
+   * LRU cache of rendered frames keyed by the pose (theta, phi) quantized to step radians.
+   * only valid while the rest of the scene is static; call clear() after changing it.
+   * with prewarm, the poses around each drawn one are rendered by a background thread,
+   * so render must be safe to call from two threads at once.
+   * prewarming stops once the budget is full.
+   */
+  class render_cache {
+  public:
+    typedef std::function<void(const frame_buffer & dst, double theta, double phi)> renderer;
+    typedef std::pair<long, long> pose_key;
+
+    render_cache(renderer render, double step, std::size_t budget_bytes, bool prewarm = false);
+    ~render_cache();
+    render_cache(const render_cache &) = delete;
+    render_cache & operator = (const render_cache &) = delete;
+
+    // fills dst with the frame of the nearest quantized pose, rendering it on a miss
+    void draw(const frame_buffer & dst, double theta, double phi);
+    void clear();
+
+    std::size_t size() const;
+    std::uint64_t hits() const;
+    std::uint64_t misses() const;
+
+  private:
+    struct entry {
+      pose_key key;
+      std::shared_ptr<const std::vector<unsigned char>> pixels; // rows packed without padding
+    };
+
+    pose_key quantize(double theta, double phi) const;
+    void flush(); // caller holds mtx
+    bool has_room() const; // caller holds mtx
+    // frames rendered before a flush (generation changed) are dropped.
+    // prewarmed frames go to the cold end and are only kept while there is free room,
+    // so they never push out frames in use
+    void insert(const pose_key & key,
+                std::shared_ptr<const std::vector<unsigned char>> pixels,
+                std::uint64_t gen,
+                bool used);
+    void request_neighbours(const pose_key & key);
+    void prewarm_loop();
+
+    renderer render;
+    double step;
+    std::size_t budget_bytes;
+
+    mutable std::mutex mtx;
+    std::list<entry> lru; // most recently used first
+    std::map<pose_key, std::list<entry>::iterator> index;
+    // geometry of the cached frames; a dst of another shape flushes the cache
+    unsigned int width, height;
+    pixel_format format;
+    std::uint64_t generation; // bumped by every flush
+    std::uint64_t hit_n, miss_n;
+
+    bool prewarm;
+    bool stopping;
+    std::deque<pose_key> pending;
+    std::condition_variable pending_cv;
+    std::thread worker;
+  };
+}
+
+#endif
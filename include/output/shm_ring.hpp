@@ -0,0 +1,105 @@
+#ifndef OUTPUT_SHM_RING
+#define OUTPUT_SHM_RING
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include "sink.hpp"
+
+namespace vo {
+  /*
+   * POSIX shared memory layout (/dev/shm/<name>):
+   *
+   * [shm_ring_header][slot 0][slot 1]...[slot n-1]
+   *
+   * each slot is a shm_slot_header padded to slot_align bytes,
+   * followed by height * stride bytes of pixels.
+   * frame number seq (starting from 1) lives in slot seq % slot_count.
+   */
+  const std::uint32_t shm_ring_magic = 0x52425256; // "VRBR"
+  const std::uint32_t shm_ring_version = 1;
+  const std::size_t slot_align = 64;
+
+  struct shm_ring_header {
+    std::atomic<std::uint32_t> magic; // written last by the writer
+    std::uint32_t version;
+    std::uint32_t slot_count, width, height;
+    pixel_format format;
+    std::uint64_t stride; // bytes per row
+    std::uint64_t slot_stride; // bytes from one slot to the next
+    std::uint64_t data_offset; // offset of slot 0
+    std::atomic<std::uint64_t> latest; // newest committed frame (0 = none yet)
+  };
+
+  struct shm_slot_header {
+    std::atomic<std::uint64_t> lock; // seqlock: odd while the writer fills the slot
+    std::atomic<std::uint64_t> seq;
+    std::atomic<std::uint64_t> timestamp_ns;
+  };
+
+  static_assert(std::atomic<std::uint64_t>::is_always_lock_free,
+                "shared memory ring needs lock-free 64bit atomics");
+
+  /*
+   * writer side. creates (and on destruction unlinks) the shared memory object.
+   * an existing ring of the same name is an error, unless replace is set:
+   * then the old object is unlinked first and readers still attached keep its memory.
+   */
+  class shm_ring_sink : public sink {
+  public:
+    shm_ring_sink(const std::string & name,
+                  unsigned int width,
+                  unsigned int height,
+                  unsigned int slot_count = 4,
+                  pixel_format format = pixel_format::RGB24,
+                  bool replace = false);
+    ~shm_ring_sink();
+    shm_ring_sink(const shm_ring_sink &) = delete;
+    shm_ring_sink & operator = (const shm_ring_sink &) = delete;
+
+    frame_buffer acquire() override;
+    void commit(std::uint64_t timestamp_ns) override;
+
+  private:
+    std::string name;
+    unsigned char * base;
+    std::size_t size;
+    std::uint64_t next_seq;
+    bool acquired;
+  };
+
+  // pixels point into the shared mapping; nothing is copied
+  struct frame_view {
+    const unsigned char * data;
+    unsigned int width, height;
+    std::size_t stride;
+    pixel_format format;
+    std::uint64_t seq, timestamp_ns;
+    unsigned int slot;
+    std::uint64_t lock; // slot lock value when the view was taken
+  };
+
+  // reader side. maps an existing ring read-only.
+  class shm_ring_reader {
+  public:
+    explicit shm_ring_reader(const std::string & name);
+    ~shm_ring_reader();
+    shm_ring_reader(const shm_ring_reader &) = delete;
+    shm_ring_reader & operator = (const shm_ring_reader &) = delete;
+
+    const shm_ring_header & header() const;
+    std::uint64_t latest() const;
+    // newest frame whose seq is greater than after_seq, if any
+    std::optional<frame_view> next(std::uint64_t after_seq = 0) const;
+    // false if the writer has reused the slot since the view was taken.
+    // check it after consuming the pixels.
+    bool valid(const frame_view & v) const;
+
+  private:
+    const unsigned char * base;
+    std::size_t size;
+  };
+}
+
+#endif
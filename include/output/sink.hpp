@@ -0,0 +1,38 @@
+#ifndef OUTPUT_SINK
+#define OUTPUT_SINK
+#include <cstddef>
+#include <cstdint>
+
+namespace vo {
+  enum class pixel_format : std::uint32_t {
+    RGB24 = 0,
+    BGR24 = 1,
+  };
+
+  struct frame_buffer {
+    unsigned char * data;
+    unsigned int width, height;
+    std::size_t stride; // bytes per row
+    pixel_format format;
+  };
+
+  /*
+   * destination of rendered frames.
+   * the renderer draws straight into the buffer returned by acquire()
+   * and publishes it with commit().
+   */
+  class sink {
+  public:
+    virtual ~sink() = default;
+    virtual frame_buffer acquire() = 0;
+    virtual void commit(std::uint64_t timestamp_ns) = 0;
+
+    // copy a frame rendered elsewhere (swapping channels if needed)
+    void write(const frame_buffer & src, std::uint64_t timestamp_ns);
+  };
+
+  // steady clock (CLOCK_MONOTONIC on Linux), comparable between processes
+  std::uint64_t now_ns();
+}
+
+#endif
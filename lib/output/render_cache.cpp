@@ -0,0 +1,180 @@
+#include <cmath>
+#include <cstring>
+#include <iterator>
+#include "sink.hpp"
+#include "render_cache.hpp"
+
+namespace vo {
+  render_cache::render_cache(renderer render, double step, std::size_t budget_bytes, bool prewarm)
+    : render(std::move(render)), step(step), budget_bytes(budget_bytes),
+      width(0), height(0), format(pixel_format::RGB24), generation(0), hit_n(0), miss_n(0),
+      prewarm(prewarm), stopping(false) {
+    if (prewarm) worker = std::thread(&render_cache::prewarm_loop, this);
+  }
+
+  render_cache::~render_cache() {
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      stopping = true;
+    }
+    pending_cv.notify_all();
+    if (worker.joinable()) worker.join();
+  }
+
+  render_cache::pose_key render_cache::quantize(double theta, double phi) const {
+    return {std::lround(theta / step), std::lround(phi / step)};
+  }
+
+  void render_cache::draw(const frame_buffer & dst, double theta, double phi) {
+    // e.g. no face found in the camera frame; not a pose worth keeping
+    if (!std::isfinite(theta) || !std::isfinite(phi)) {
+      render(dst, theta, phi);
+      return;
+    }
+    const pose_key key = quantize(theta, phi);
+    const std::size_t row_bytes = 3 * (std::size_t)dst.width;
+    std::shared_ptr<const std::vector<unsigned char>> pixels;
+    std::uint64_t gen;
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      if (dst.width != width || dst.height != height || dst.format != format) {
+        flush();
+        width = dst.width;
+        height = dst.height;
+        format = dst.format;
+      }
+      auto it = index.find(key);
+      if (it != index.end()) {
+        lru.splice(lru.begin(), lru, it->second);
+        pixels = it->second->pixels;
+        hit_n++;
+      } else {
+        miss_n++;
+      }
+      gen = generation;
+    }
+
+    if (pixels) {
+      for (std::size_t i = 0; i < dst.height; i++) {
+        std::memcpy(dst.data + i * dst.stride, pixels->data() + i * row_bytes, row_bytes);
+      }
+    } else {
+      // render at the quantized pose so the cached frame is exact for its key
+      render(dst, key.first * step, key.second * step);
+      auto packed = std::make_shared<std::vector<unsigned char>>(row_bytes * dst.height);
+      for (std::size_t i = 0; i < dst.height; i++) {
+        std::memcpy(packed->data() + i * row_bytes, dst.data + i * dst.stride, row_bytes);
+      }
+      insert(key, std::move(packed), gen, true);
+    }
+
+    if (prewarm) request_neighbours(key);
+  }
+
+  void render_cache::clear() {
+    std::lock_guard<std::mutex> lock(mtx);
+    flush();
+  }
+
+  void render_cache::flush() {
+    lru.clear();
+    index.clear();
+    pending.clear();
+    generation++;
+  }
+
+  bool render_cache::has_room() const {
+    const std::size_t frame_bytes = 3 * (std::size_t)width * height;
+    return (lru.size() + 1) * frame_bytes <= budget_bytes;
+  }
+
+  std::size_t render_cache::size() const {
+    std::lock_guard<std::mutex> lock(mtx);
+    return lru.size();
+  }
+
+  std::uint64_t render_cache::hits() const {
+    std::lock_guard<std::mutex> lock(mtx);
+    return hit_n;
+  }
+
+  std::uint64_t render_cache::misses() const {
+    std::lock_guard<std::mutex> lock(mtx);
+    return miss_n;
+  }
+
+  void render_cache::insert(const pose_key & key,
+                            std::shared_ptr<const std::vector<unsigned char>> pixels,
+                            std::uint64_t gen,
+                            bool used) {
+    std::lock_guard<std::mutex> lock(mtx);
+    const std::size_t frame_bytes = 3 * (std::size_t)width * height;
+    // rendered before a flush, or the budget can't hold even one frame
+    if (gen != generation || frame_bytes > budget_bytes) return;
+    auto it = index.find(key);
+    if (it != index.end()) {
+      if (used) lru.splice(lru.begin(), lru, it->second);
+      return;
+    }
+    if (!used && !has_room()) return;
+    if (used) {
+      lru.push_front({key, std::move(pixels)});
+      index[key] = lru.begin();
+    } else {
+      lru.push_back({key, std::move(pixels)});
+      index[key] = std::prev(lru.end());
+    }
+    while (lru.size() * frame_bytes > budget_bytes) {
+      index.erase(lru.back().key);
+      lru.pop_back();
+    }
+  }
+
+  void render_cache::request_neighbours(const pose_key & key) {
+    const auto [t, p] = key;
+    // theta moves the most, so its neighbours go first
+    const pose_key neighbours[] = {{t - 1, p}, {t + 1, p},
+                                   {t, p - 1}, {t, p + 1},
+                                   {t - 1, p - 1}, {t + 1, p - 1},
+                                   {t - 1, p + 1}, {t + 1, p + 1}};
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      // poses requested around an older frame are no longer interesting
+      pending.clear();
+      if (!has_room()) return;
+      for (const auto & n : neighbours) {
+        if (index.find(n) == index.end()) pending.push_back(n);
+      }
+      if (pending.empty()) return;
+    }
+    pending_cv.notify_one();
+  }
+
+  void render_cache::prewarm_loop() {
+    for (;;) {
+      pose_key key;
+      unsigned int w, h;
+      pixel_format f;
+      std::uint64_t gen;
+      {
+        std::unique_lock<std::mutex> lock(mtx);
+        pending_cv.wait(lock, [this] { return stopping || !pending.empty(); });
+        if (stopping) return;
+        key = pending.front();
+        pending.pop_front();
+        if (index.find(key) != index.end()) continue;
+        if (!has_room()) {
+          pending.clear();
+          continue;
+        }
+        w = width;
+        h = height;
+        f = format;
+        gen = generation;
+      }
+      auto pixels = std::make_shared<std::vector<unsigned char>>(3 * (std::size_t)w * h);
+      render({pixels->data(), w, h, 3 * (std::size_t)w, f}, key.first * step, key.second * step);
+      insert(key, std::move(pixels), gen, false);
+    }
+  }
+}
@@ -0,0 +1,192 @@
+#include <cerrno>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "sink.hpp"
+#include "shm_ring.hpp"
+
+namespace vo {
+  static std::size_t round_up(std::size_t n, std::size_t a) {
+    return (n + a - 1) / a * a;
+  }
+
+  static std::system_error shm_error(const std::string & what, const std::string & name) {
+    return std::system_error(errno, std::generic_category(), what + " " + name);
+  }
+
+  static const shm_slot_header * slot_header(const unsigned char * base, std::uint64_t seq) {
+    const auto * h = reinterpret_cast<const shm_ring_header *>(base);
+    return reinterpret_cast<const shm_slot_header *>
+      (base + h->data_offset + (seq % h->slot_count) * h->slot_stride);
+  }
+
+  static shm_slot_header * slot_header(unsigned char * base, std::uint64_t seq) {
+    return const_cast<shm_slot_header *>
+      (slot_header(const_cast<const unsigned char *>(base), seq));
+  }
+
+  shm_ring_sink::shm_ring_sink(const std::string & name,
+                               unsigned int width,
+                               unsigned int height,
+                               unsigned int slot_count,
+                               pixel_format format,
+                               bool replace)
+    : name(name), base(nullptr), size(0), next_seq(1), acquired(false) {
+    if (width == 0 || height == 0 || slot_count == 0) {
+      throw std::invalid_argument("frame ring " + name + " needs a nonzero size and slot count");
+    }
+    const std::size_t stride = 3 * (std::size_t)width;
+    const std::size_t slot_stride = slot_align + round_up(stride * height, slot_align);
+    const std::size_t data_offset = round_up(sizeof(shm_ring_header), slot_align);
+    size = data_offset + slot_stride * slot_count;
+
+    if (replace) shm_unlink(name.c_str());
+    int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0 && errno == EEXIST) {
+      throw std::system_error(errno, std::generic_category(),
+                              "frame ring " + name + " already exists"
+                              " (another writer running, or a stale ring to replace)");
+    }
+    if (fd < 0) throw shm_error("shm_open", name);
+    if (ftruncate(fd, size) < 0) {
+      auto e = shm_error("ftruncate", name);
+      close(fd);
+      shm_unlink(name.c_str());
+      throw e;
+    }
+    void * p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+      auto e = shm_error("mmap", name);
+      shm_unlink(name.c_str());
+      throw e;
+    }
+    base = static_cast<unsigned char *>(p);
+
+    auto * h = new (base) shm_ring_header;
+    h->magic.store(0, std::memory_order_relaxed);
+    h->version = shm_ring_version;
+    h->slot_count = slot_count;
+    h->width = width;
+    h->height = height;
+    h->format = format;
+    h->stride = stride;
+    h->slot_stride = slot_stride;
+    h->data_offset = data_offset;
+    h->latest.store(0, std::memory_order_relaxed);
+    for (std::size_t i = 0; i < slot_count; i++) {
+      auto * s = new (base + data_offset + i * slot_stride) shm_slot_header;
+      s->lock.store(0, std::memory_order_relaxed);
+      s->seq.store(0, std::memory_order_relaxed);
+      s->timestamp_ns.store(0, std::memory_order_relaxed);
+    }
+    // readers refuse to attach until the magic is visible
+    h->magic.store(shm_ring_magic, std::memory_order_release);
+  }
+
+  shm_ring_sink::~shm_ring_sink() {
+    munmap(base, size);
+    shm_unlink(name.c_str());
+  }
+
+  frame_buffer shm_ring_sink::acquire() {
+    const auto * h = reinterpret_cast<const shm_ring_header *>(base);
+    auto * s = slot_header(base, next_seq);
+    if (!acquired) {
+      // odd lock tells readers the pixels are about to change
+      s->lock.store(s->lock.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+      acquired = true;
+    }
+    return {reinterpret_cast<unsigned char *>(s) + slot_align,
+            h->width, h->height, h->stride, h->format};
+  }
+
+  void shm_ring_sink::commit(std::uint64_t timestamp_ns) {
+    if (!acquired) return;
+    auto * h = reinterpret_cast<shm_ring_header *>(base);
+    auto * s = slot_header(base, next_seq);
+    s->seq.store(next_seq, std::memory_order_relaxed);
+    s->timestamp_ns.store(timestamp_ns, std::memory_order_relaxed);
+    s->lock.store(s->lock.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    h->latest.store(next_seq, std::memory_order_release);
+    next_seq++;
+    acquired = false;
+  }
+
+  shm_ring_reader::shm_ring_reader(const std::string & name)
+    : base(nullptr), size(0) {
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0) throw shm_error("shm_open", name);
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+      auto e = shm_error("fstat", name);
+      close(fd);
+      throw e;
+    }
+    size = st.st_size;
+    if (size < sizeof(shm_ring_header)) {
+      close(fd);
+      throw std::system_error(EINVAL, std::generic_category(), "truncated ring " + name);
+    }
+    void * p = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) throw shm_error("mmap", name);
+    base = static_cast<const unsigned char *>(p);
+
+    const auto & h = header();
+    if (h.magic.load(std::memory_order_acquire) != shm_ring_magic
+        || h.version != shm_ring_version
+        || h.slot_count == 0 || h.width == 0 || h.height == 0
+        // each row, slot and the whole ring must fit in what contains it
+        // (divisions, so a corrupt header can't overflow the checks)
+        || h.width > h.stride / 3
+        || h.slot_stride < slot_align
+        || h.stride > (h.slot_stride - slot_align) / h.height
+        || h.data_offset < sizeof(shm_ring_header)
+        || h.data_offset > size
+        || h.slot_stride > (size - h.data_offset) / h.slot_count) {
+      munmap(const_cast<unsigned char *>(base), size);
+      throw std::system_error(EINVAL, std::generic_category(), "not a frame ring " + name);
+    }
+  }
+
+  shm_ring_reader::~shm_ring_reader() {
+    munmap(const_cast<unsigned char *>(base), size);
+  }
+
+  const shm_ring_header & shm_ring_reader::header() const {
+    return *reinterpret_cast<const shm_ring_header *>(base);
+  }
+
+  std::uint64_t shm_ring_reader::latest() const {
+    return header().latest.load(std::memory_order_acquire);
+  }
+
+  std::optional<frame_view> shm_ring_reader::next(std::uint64_t after_seq) const {
+    const auto & h = header();
+    const std::uint64_t seq = latest();
+    if (seq <= after_seq) return std::nullopt;
+    const auto * s = slot_header(base, seq);
+    const std::uint64_t lock = s->lock.load(std::memory_order_acquire);
+    if (lock % 2 == 1) return std::nullopt; // writer lapped us and is filling the slot
+    frame_view v = {reinterpret_cast<const unsigned char *>(s) + slot_align,
+                    h.width, h.height, h.stride, h.format,
+                    s->seq.load(std::memory_order_relaxed),
+                    s->timestamp_ns.load(std::memory_order_relaxed),
+                    (unsigned int)(seq % h.slot_count),
+                    lock};
+    if (!valid(v) || v.seq <= after_seq) return std::nullopt;
+    return v;
+  }
+
+  bool shm_ring_reader::valid(const frame_view & v) const {
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return slot_header(base, v.seq)->lock.load(std::memory_order_relaxed) == v.lock;
+  }
+}
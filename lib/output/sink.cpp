@@ -0,0 +1,31 @@
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include "sink.hpp"
+
+namespace vo {
+  void sink::write(const frame_buffer & src, std::uint64_t timestamp_ns) {
+    const frame_buffer dst = acquire();
+    const unsigned int h = std::min(src.height, dst.height);
+    const unsigned int w = std::min(src.width, dst.width);
+    for (std::size_t i = 0; i < h; i++) {
+      const unsigned char * s = src.data + i * src.stride;
+      unsigned char * d = dst.data + i * dst.stride;
+      if (src.format == dst.format) {
+        std::memcpy(d, s, 3 * w);
+        continue;
+      }
+      for (std::size_t j = 0; j < w; j++) {
+        d[3 * j + 0] = s[3 * j + 2];
+        d[3 * j + 1] = s[3 * j + 1];
+        d[3 * j + 2] = s[3 * j + 0];
+      }
+    }
+    commit(timestamp_ns);
+  }
+
+  std::uint64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>
+      (std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+}
@@ -0,0 +1,77 @@
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include "sink.hpp"
+#include "shm_ring.hpp"
+
+/*
+ * tiny consumer of the frame ring written by `vrun --shm NAME`.
+ * usage: vread NAME [FRAMES] [OUT.ppm]
+ * prints sequence numbers, timestamps and latency of each frame seen,
+ * and optionally dumps the last one as a ppm image.
+ */
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    std::cerr << "usage: " << argv[0] << " NAME [FRAMES] [OUT.ppm]" << std::endl;
+    return -1;
+  }
+  const std::string name = argv[1];
+  const unsigned long frames = argc >= 3 ? std::stoul(argv[2]) : 100;
+  const std::string out = argc >= 4 ? argv[3] : "";
+
+  vo::shm_ring_reader reader(name);
+  const auto & h = reader.header();
+  std::cout << "width=" << h.width << " height=" << h.height
+            << " slots=" << h.slot_count << std::endl;
+
+  std::uint64_t last = 0;
+  unsigned long seen = 0, torn = 0;
+  while (seen < frames) {
+    auto v = reader.next(last);
+    if (!v) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      continue;
+    }
+    const std::uint64_t latency = vo::now_ns() - v->timestamp_ns;
+    // touch the pixels in place, then make sure the writer didn't overwrite them meanwhile
+    std::uint64_t sum = 0;
+    for (std::size_t i = 0; i < v->height; i++) {
+      const unsigned char * row = v->data + i * v->stride;
+      for (std::size_t j = 0; j < 3 * (std::size_t)v->width; j++) sum += row[j];
+    }
+    if (!reader.valid(*v)) {
+      torn++;
+      continue;
+    }
+    std::cout << "seq=" << v->seq
+              << " ts=" << v->timestamp_ns
+              << " latency_us=" << latency / 1000
+              << " dropped=" << (last == 0 ? 0 : v->seq - last - 1)
+              << " sum=" << sum << std::endl;
+    last = v->seq;
+    seen++;
+
+    if (seen == frames && !out.empty()) {
+      std::ofstream ppm(out, std::ios::binary);
+      ppm << "P6\n" << v->width << " " << v->height << "\n255\n";
+      for (std::size_t i = 0; i < v->height; i++) {
+        const unsigned char * row = v->data + i * v->stride;
+        for (std::size_t j = 0; j < v->width; j++) {
+          const unsigned char * px = row + 3 * j;
+          if (v->format == vo::pixel_format::RGB24) {
+            ppm.put(px[0]).put(px[1]).put(px[2]);
+          } else {
+            ppm.put(px[2]).put(px[1]).put(px[0]);
+          }
+        }
+      }
+      if (!reader.valid(*v)) std::cerr << "warning: last frame was overwritten while saving" << std::endl;
+    }
+  }
+  std::cout << "torn=" << torn << std::endl;
+  return 0;
+}
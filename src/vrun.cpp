@@ -1,11 +1,18 @@
 #include <opencv2/opencv.hpp>
 #include <cmath>
+#include <csignal>
 #include <iostream>
+#include <memory>
 #include <string>
+#include <system_error>
 #include <variant>
+#include <vector>
 
 #include "statistics.hpp"
 #include "threedim.hpp"
+#include "sink.hpp"
+#include "shm_ring.hpp"
+#include "render_cache.hpp"
 
 using namespace cv;
 
@@ -38,15 +45,27 @@ const std::pair<td::point, std::vector<td::colored_triangle>> face =
    }
   };
 
-Mat calc(const td::screen & scr,
-         const std::vector<td::colored_triangle> & fixed_objs,
-         const std::pair<td::point, std::vector<td::colored_triangle>> & face,
-         const double theta,
-         const double phi) {
-  const unsigned int scale = 8;
-  const unsigned int h = 50;
-  const unsigned int w = 50;
-  Mat ret = Mat::zeros(scale * h, scale * w, CV_8UC3);
+const unsigned int render_scale = 8;
+const unsigned int render_h = 50;
+const unsigned int render_w = 50;
+
+Vec3b pixel(const vo::pixel_format format, unsigned char r, unsigned char g, unsigned char b) {
+  if (format == vo::pixel_format::RGB24) return {r, g, b};
+  return {b, g, r};
+}
+
+// renders straight into dst, which must be (render_scale * render_h) x (render_scale * render_w)
+void calc(const vo::frame_buffer & dst,
+          const td::screen & scr,
+          const std::vector<td::colored_triangle> & fixed_objs,
+          const std::pair<td::point, std::vector<td::colored_triangle>> & face,
+          const double theta,
+          const double phi) {
+  const unsigned int scale = render_scale;
+  const unsigned int h = render_h;
+  const unsigned int w = render_w;
+  Mat ret(dst.height, dst.width, CV_8UC3, dst.data, dst.stride);
+  const Vec3b background = pixel(dst.format, 0, 255, 0);
   std::vector<td::colored_triangle> objs = fixed_objs;
   const auto & [face_center, face_objs] = face;
   for (const auto & obj : face_objs) {
@@ -60,29 +79,127 @@ Mat calc(const td::screen & scr,
         for (std::size_t di = 0; di < scale; di++) {
           for (std::size_t dj = 0; dj < scale; dj++) {
             ret.at<Vec3b>(scale * (h - i) - di - 1, scale * j + dj) =
-              {
-               (unsigned char)(255 * b),
-               (unsigned char)(255 * g),
-               (unsigned char)(255 * r)
-              };
+              pixel(dst.format,
+                    (unsigned char)(255 * r),
+                    (unsigned char)(255 * g),
+                    (unsigned char)(255 * b));
           }
         }
       } else {
         for (std::size_t di = 0; di < scale; di++) {
           for (std::size_t dj = 0; dj < scale; dj++) {
-            ret.at<Vec3b>(scale * (h - i) - di - 1, scale * j + dj) = {0, 255, 0};
+            ret.at<Vec3b>(scale * (h - i) - di - 1, scale * j + dj) = background;
           }
         }
 
-         ret.at<Vec3b>(h - 1 - i, j) = {0, 255, 0};
+         ret.at<Vec3b>(h - 1 - i, j) = background;
       }
     }
   }
-  return ret;
 }
 
+// highgui window, the original output
+class display_sink : public vo::sink {
+public:
+  display_sink(const std::string & window_name, unsigned int width, unsigned int height)
+    : window_name(window_name), buf(height, width, CV_8UC3) {
+    namedWindow(window_name, WINDOW_AUTOSIZE);
+  }
+
+  vo::frame_buffer acquire() override {
+    return {buf.data, (unsigned int)buf.cols, (unsigned int)buf.rows, buf.step,
+            vo::pixel_format::BGR24};
+  }
+
+  void commit(std::uint64_t) override {
+    imshow(window_name, buf);
+  }
+
+private:
+  std::string window_name;
+  Mat buf;
+};
+
+// set by SIGINT/SIGTERM, so the sinks (and the shared memory ring) are cleaned up
+volatile std::sig_atomic_t stop_requested = 0;
+
+void request_stop(int) {
+  stop_requested = 1;
+}
+
+/*
+ * usage: vrun [--shm NAME] [--shm-replace] [--no-display] [--cache-step DEG] [--cache-mb MB] [--prewarm]
+ *   --shm NAME        publish frames to the POSIX shared memory ring /NAME (read it with vread)
+ *   --shm-replace     take over /NAME if it already exists (e.g. left by a crashed vrun)
+ *   --no-display      don't open the highgui window
+ *   --cache-step DEG  reuse avatar frames rendered within DEG degrees (0 = render every frame)
+ *   --cache-mb MB     memory budget of the render cache
+ *   --prewarm         render the poses around the current one in the background
+ */
+int main(int argc, char** argv) {
+  std::string shm_name;
+  bool shm_replace = false;
+  bool display = true;
+  double cache_step_deg = 1;
+  std::size_t cache_mb = 64;
+  bool prewarm = false;
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    if (arg == "--shm" && i + 1 < argc) {
+      shm_name = argv[++i];
+    } else if (arg == "--shm-replace") {
+      shm_replace = true;
+    } else if (arg == "--no-display") {
+      display = false;
+    } else if (arg == "--cache-step" && i + 1 < argc) {
+      cache_step_deg = std::stod(argv[++i]);
+    } else if (arg == "--cache-mb" && i + 1 < argc) {
+      cache_mb = std::stoul(argv[++i]);
+    } else if (arg == "--prewarm") {
+      prewarm = true;
+    } else {
+      std::cerr << "usage: " << argv[0]
+                << " [--shm NAME] [--shm-replace] [--no-display]"
+                << " [--cache-step DEG] [--cache-mb MB] [--prewarm]"
+                << std::endl;
+      return -1;
+    }
+  }
+
+  std::signal(SIGINT, request_stop);
+  std::signal(SIGTERM, request_stop);
+
+  // fixed_objs never changes, so the avatar only depends on (theta, phi)
+  std::unique_ptr<vo::render_cache> cache;
+  if (cache_step_deg > 0) {
+    cache = std::make_unique<vo::render_cache>
+      ([](const vo::frame_buffer & dst, double theta, double phi) {
+         calc(dst, scr, fixed_objs, face, theta, phi);
+       },
+       cache_step_deg * M_PI / 180, cache_mb << 20, prewarm);
+  }
+
+  // the frame is rendered into the first sink; the others get a copy
+  std::vector<std::unique_ptr<vo::sink>> sinks;
+  try {
+    if (!shm_name.empty()) {
+      sinks.push_back(std::make_unique<vo::shm_ring_sink>
+                      (shm_name, render_scale * render_w, render_scale * render_h,
+                       4, vo::pixel_format::RGB24, shm_replace));
+    }
+  } catch (const std::system_error & e) {
+    std::cerr << e.what() << std::endl;
+    return -1;
+  }
+  if (display) {
+    sinks.push_back(std::make_unique<display_sink>
+                    ("", render_scale * render_w, render_scale * render_h));
+  }
+  if (sinks.empty()) {
+    std::cerr << "no output: give --shm NAME or drop --no-display" << std::endl;
+    return -1;
+  }
 
-int main(int, char**) {
   VideoCapture cap(0);
   if(!cap.isOpened()) return -1;
 
@@ -94,11 +211,9 @@ int main(int, char**) {
   
   std::cout << "fps=" << fps << " width=" << width << " height=" << height << std::endl;
 
-  std::string frame_window_name = "";
-  namedWindow(frame_window_name, WINDOW_AUTOSIZE);
-
-  for (;;) {
+  while (!stop_requested) {
     cap >> frame;
+    if (frame.empty()) break; // e.g. the read was interrupted by a signal
     flip(frame, frame, 1);
     
     std::vector<float> hada_xs, hada_ys;
@@ -167,10 +282,19 @@ int main(int, char**) {
     const double phi = 0;
 
     /* render */
-    Mat virtualworld = calc(scr, fixed_objs, face, theta, phi);
+    const std::uint64_t timestamp = vo::now_ns();
+    const vo::frame_buffer virtualworld = sinks[0]->acquire();
+    if (cache) {
+      cache->draw(virtualworld, theta, phi);
+    } else {
+      calc(virtualworld, scr, fixed_objs, face, theta, phi);
+    }
 
     /* draw */
-    imshow(frame_window_name, virtualworld);
+    for (std::size_t i = 1; i < sinks.size(); i++) {
+      sinks[i]->write(virtualworld, timestamp);
+    }
+    sinks[0]->commit(timestamp);
 
     /* for demonstration
     int n = 10;